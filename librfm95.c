@@ -8,16 +8,189 @@
 #include "librfm95.h"
 #include "utils.h"
 
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#endif
+
 /* FSK 'Timeout' */
 static volatile bool rxTimeout = false;
 /* FSK 'PacketSent' */
 static volatile bool txDone = false;
 /* FSK 'PayloadReady' */
 static volatile bool rxDone = false;
+/* LoRa 'ValidHeader' */
+static volatile bool rxHeader = false;
+/* LoRa 'PayloadCrcError' */
+static volatile bool rxCrcError = false;
+
+/* Time stamps of the above events */
+static volatile uint32_t rxDoneTime = 0;
+static volatile uint32_t txDoneTime = 0;
+static volatile uint32_t rxHeaderTime = 0;
+
+/* Milliseconds since start and _rfmMicros() at the last full millisecond */
+static uint32_t clockMillis = 0;
+static uint32_t clockMicros = 0;
+
+/* TDMA frame configuration and start of the last beacon */
+static Tdma tdma = {0};
+static uint32_t tdmaBeacon = 0;
+static bool tdmaSynced = false;
+
+#ifdef RFM_DUTY_CYCLE
+/* Regulated sub-band with duty cycle 1/div, frequencies in kHz */
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    uint16_t div;
+} Band;
+
+/* EU433 and EU868 sub-bands (ERC REC 70-03), first match applies */
+static const Band bands[] PROGMEM = {
+    {433050, 434790, 10},   // 10%
+    {863000, 865000, 1000}, // 0.1%
+    {865000, 868000, 100},  // 1%
+    {868000, 868600, 100},  // 1%
+    {868700, 869200, 1000}, // 0.1%
+    {869400, 869650, 10},   // 10%
+    {869700, 870000, 100},  // 1%
+    {863000, 870000, 1000}  // 0.1% in between the above
+};
+
+/* Airtime in ms sent in a sub-band, at a time in ms, free if airtime is 0 */
+typedef struct {
+    uint32_t at;
+    uint32_t airtime;
+    uint8_t band;
+} Airtime;
+
+/* Airtime sent in the last hour */
+static Airtime airtimes[RFM_DC_RECORDS];
+
+_Static_assert(RFM_DC_RECORDS > array_length(bands), 
+        "RFM_DC_RECORDS must be greater than the number of sub-bands");
+
+/* Send queue and buffer for coalesced messages */
+typedef struct {
+    uint8_t *payload;
+    uint8_t size;
+    uint8_t node;
+    uint8_t prio;
+    bool coalesce;
+} Message;
+
+static Message queue[RFM_QUEUE_SIZE];
+static uint8_t queueLen = 0;
+static uint8_t queueFrame[RFM_LORA_MSG_SIZE];
+#endif
+
+/* LoRa signal bandwidths in Hz */
+static const uint32_t loRaBandwidths[] PROGMEM = {
+    7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+};
 
 /* Current mode: LoRa or FSK */
 static bool lora = false;
 
+#ifdef RFM_FSK_RX_CONTINUOUS
+/* Packet received in continuous FSK receive mode */
+typedef struct {
+    uint8_t len;
+    uint8_t rssi;
+    bool crc;
+    uint32_t time;
+    uint8_t payload[RFM_FSK_MSG_SIZE];
+} Packet;
+
+/* Continuous FSK receive mode and ring buffer for received packets */
+static volatile bool rxContinuous = false;
+static Packet rxPackets[RFM_FSK_RX_PACKETS];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+#else
+static const bool rxContinuous = false;
+#endif
+
+/* Bulk SPI transfer in progress */
+static volatile bool txBufBusy = false;
+
+/* Current operating mode */
+static volatile uint8_t currentMode = RFM_MODE_SLEEP;
+
+#ifdef RFM_ENERGY
+/* Time spent in each operating mode in ms and µs, and clock time in ms 
+ * and µs since when in the current one */
+static uint32_t modeTime[RFM_MASK_MODE + 1];
+static uint16_t modeTimeMicros[RFM_MASK_MODE + 1];
+static uint32_t modeSince = 0;
+static uint16_t modeSinceMicros = 0;
+
+/* Estimated charge consumed in µC, nC and pC */
+static uint32_t chargeMicro = 0;
+static uint16_t chargeNano = 0;
+static uint16_t chargePico = 0;
+
+/* Estimated supply current in mA in TX mode with PA_BOOST from +2 to +20 dBm.
+ * The datasheet only gives 87 mA at +17 dBm and 120 mA at +20 dBm, so the
+ * values are 54 mA + 0.66 mA/mW, the straight line through both in mW. */
+static const uint8_t txCurrent[] PROGMEM = {
+    55, 55, 56, 56, 57, 57, 58, 59, 61, 62, 64, 67, 71, 75, 80, 87, 96, 106, 120
+};
+#endif
+
+/* RegPaConfig, RegPaDac and RegOcp for PA_BOOST from +2 to +20 dBm */
+static const uint8_t paLevels[][3] PROGMEM = {
+    {0xc0, 0x84, 0x2b}, {0xc1, 0x84, 0x2b}, {0xc2, 0x84, 0x2b}, 
+    {0xc3, 0x84, 0x2b}, {0xc4, 0x84, 0x2b}, {0xc5, 0x84, 0x2b}, 
+    {0xc6, 0x84, 0x2b}, {0xc7, 0x84, 0x2b}, {0xc8, 0x84, 0x2b}, 
+    {0xc9, 0x84, 0x2b}, {0xca, 0x84, 0x2b}, {0xcb, 0x84, 0x2b}, 
+    {0xcc, 0x84, 0x2b}, {0xcd, 0x84, 0x2b}, {0xce, 0x84, 0x2b}, 
+    {0xcf, 0x84, 0x2b}, 
+    // high power mode, OCP raised to 240 mA
+    {0xcd, 0x87, 0x3b}, {0xce, 0x87, 0x3b}, {0xcf, 0x87, 0x3b}
+};
+
+/* Current carrier frequency in kHz */
+static uint32_t freqKHz = 0;
+
+__attribute__((weak)) void _rfmTxBuf(const uint8_t *out, uint8_t *in, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t data = _rfmTx(out == NULL ? 0x00 : out[i]);
+        if (in != NULL) {
+            in[i] = data;
+        }
+    }
+    rfmTxBufDone();
+}
+
+void rfmTxBufDone(void) {
+    txBufBusy = false;
+}
+
+/**
+ * Transmits/receives the given number of bytes with _rfmTxBuf() and
+ * waits until the transfer is complete.
+ *
+ * @param out data to transmit or NULL
+ * @param in buffer for received data or NULL
+ * @param len number of bytes
+ */
+static void txBuf(const uint8_t *out, uint8_t *in, size_t len) {
+    if (len == 0) {
+        // a transfer of nothing might never complete
+        return;
+    }
+
+    txBufBusy = true;
+    _rfmTxBuf(out, in, len);
+    do {} while (txBufBusy);
+}
+
 /**
  * Writes the given value to the given register.
  *
@@ -46,13 +219,343 @@ static uint8_t regRead(uint8_t reg) {
     return value;
 }
 
+/**
+ * Writes the given number of values to consecutive registers starting
+ * with the given register in one burst.
+ *
+ * @param reg first register
+ * @param values
+ * @param len number of values
+ */
+static void regWriteBurst(uint8_t reg, const uint8_t *values, size_t len) {
+    _rfmSel();
+    _rfmTx(reg | 0x80);
+    for (size_t i = 0; i < len; i++) {
+        _rfmTx(values[i]);
+    }
+    _rfmDes();
+}
+
+/**
+ * Reads the given number of values from consecutive registers starting
+ * with the given register in one burst.
+ *
+ * @param reg first register
+ * @param values
+ * @param len number of values
+ */
+static void regReadBurst(uint8_t reg, uint8_t *values, size_t len) {
+    _rfmSel();
+    _rfmTx(reg & 0x7f);
+    for (size_t i = 0; i < len; i++) {
+        values[i] = _rfmTx(0x00);
+    }
+    _rfmDes();
+}
+
+/**
+ * Waits for the given number of microseconds, measured with the
+ * free running _rfmMicros() required from the application.
+ *
+ * @param us microseconds
+ */
+static void waitMicros(uint32_t us) {
+    uint32_t start = _rfmMicros();
+    do {} while (_rfmMicros() - start < us);
+}
+
+/**
+ * Sets the carrier frequency to the given frequency in kHz.
+ *
+ * @param kHz carrier frequency
+ */
+static void setFrequency(uint32_t kHz) {
+    uint32_t frf = RFM_FRF(kHz);
+    uint8_t values[] = {frf >> 16, frf >> 8, frf >> 0};
+    regWriteBurst(RFM_FRF_MSB, values, sizeof(values));
+}
+
+/**
+ * Returns the RSSI sampling time in microseconds in FSK mode, given by
+ * RssiSmoothing and the channel filter bandwidth: 2^(smoothing + 1) samples
+ * of 1 / (4 * RxBw) each.
+ *
+ * @return sampling time
+ */
+static uint32_t rssiTimeFSK(void) {
+    uint8_t smoothing = regRead(RFM_FSK_RSSI_CONFIG) & 0x07;
+    uint8_t rxBw = regRead(RFM_FSK_RX_BW);
+    uint32_t mant = 16 + 4 * ((rxBw >> 3) & 0x03);
+    uint8_t exp = rxBw & 0x07;
+
+    // 1 / (4 * FXOSC / (mant * 2^(exp + 2))) with FXOSC = 32 MHz
+    return ((mant << (smoothing + 1 + exp)) + 31) >> 5;
+}
+
+/**
+ * Advances the millisecond clock by the time elapsed since the last update
+ * and returns it. Must be called at least every 71 minutes, before 
+ * _rfmMicros() wraps around.
+ *
+ * @return milliseconds since start
+ */
+static uint32_t clockUpdate(void) {
+    uint32_t ms = (_rfmMicros() - clockMicros) / 1000;
+    // keep the remainder for the next update
+    clockMicros += ms * 1000;
+    clockMillis += ms;
+
+    return clockMillis;
+}
+
+#ifdef RFM_ENERGY
+
+/**
+ * Returns the estimated supply current in µA in the given operating mode.
+ *
+ * @param mode operating mode
+ * @return current
+ */
+static uint32_t modeCurrent(uint8_t mode) {
+    switch (mode) {
+        case RFM_MODE_SLEEP: return 0; // 0.2 µA
+        case RFM_MODE_STDBY: return 1600;
+        case RFM_MODE_FS_TX:
+        case RFM_MODE_FS_RX: return 5800;
+        case RFM_MODE_TX: {
+            int8_t dBm = rfmGetOutputPower() - RFM_DBM_MIN;
+            return pgm_read_byte(&txCurrent[min(max(dBm, 0), 
+                    (int8_t)array_length(txCurrent) - 1)]) * 1000UL;
+        }
+        default: return 11500; // RX with LnaBoostHf
+    }
+}
+
+/**
+ * Adds the charge consumed with the given current in µA during the given 
+ * time in ms and µs.
+ *
+ * @param current in µA
+ * @param ms time
+ * @param us time below 1 ms
+ */
+static void chargeAdd(uint32_t current, uint32_t ms, uint16_t us) {
+    uint32_t pico = chargePico + current * us;
+    uint32_t nano = chargeNano + pico / 1000;
+    chargePico = pico % 1000;
+
+    // chunks of 30 s don't overflow with up to 143 mA
+    while (ms > 0) {
+        uint32_t chunk = min(ms, 30000UL);
+        nano += current * chunk;
+        chargeMicro += nano / 1000;
+        nano %= 1000;
+        ms -= chunk;
+    }
+    chargeMicro += nano / 1000;
+    chargeNano = nano % 1000;
+}
+
+/**
+ * Accounts the time spent in the current operating mode until the given
+ * time stamp and its estimated charge, and tracks the given operating mode 
+ * as current mode from then on. The time stamp may be up to 35 minutes 
+ * in the past or future.
+ *
+ * @param mode new operating mode
+ * @param now time stamp
+ */
+static void modeEnter(uint8_t mode, uint32_t now) {
+    clockUpdate();
+
+    // time stamp on the millisecond clock
+    int32_t offset = now - clockMicros;
+    uint32_t ms = clockMillis + offset / 1000;
+    int16_t us = offset % 1000;
+    if (us < 0) {
+        us += 1000;
+        ms--;
+    }
+
+    uint32_t elapsed = ms - modeSince;
+    int16_t elapsedMicros = us - modeSinceMicros;
+    if (elapsedMicros < 0) {
+        elapsedMicros += 1000;
+        elapsed--;
+    }
+
+    // ignore a time stamp before the last one
+    if ((int32_t)elapsed >= 0) {
+        uint16_t micros = modeTimeMicros[currentMode] + elapsedMicros;
+        modeTime[currentMode] += elapsed + micros / 1000;
+        modeTimeMicros[currentMode] = micros % 1000;
+        chargeAdd(modeCurrent(currentMode), elapsed, elapsedMicros);
+        modeSince = ms;
+        modeSinceMicros = us;
+    }
+    currentMode = mode & RFM_MASK_MODE;
+}
+
+#else
+
+/* Energy not accounted, only track the current mode */
+static void modeEnter(uint8_t mode, uint32_t now) {
+    currentMode = mode & RFM_MASK_MODE;
+}
+
+#endif /* RFM_ENERGY */
+
 /**
  * Sets the module to the given operating mode.
  */
 static void setMode(uint8_t mode) {
+    modeEnter(mode, _rfmMicros());
     regWrite(RFM_OP_MODE, (regRead(RFM_OP_MODE) & ~RFM_MASK_MODE) | (mode & RFM_MASK_MODE));
 }
 
+#ifdef RFM_DUTY_CYCLE
+
+/**
+ * Returns the index of the regulated sub-band of the current carrier
+ * frequency, or -1 if not regulated.
+ *
+ * @return index of sub-band
+ */
+static int8_t bandIndex(void) {
+    for (uint8_t i = 0; i < array_length(bands); i++) {
+        if (freqKHz >= pgm_read_dword(&bands[i].from) && 
+                freqKHz < pgm_read_dword(&bands[i].to)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Returns the airtime budget in ms for one hour of the sub-band with the 
+ * given index.
+ *
+ * @param band index
+ * @return airtime budget
+ */
+static uint32_t bandLimit(int8_t band) {
+    return 3600000UL / pgm_read_word(&bands[band].div);
+}
+
+/**
+ * Frees airtime records older than one hour and returns the airtime in ms 
+ * sent in the sub-band with the given index during the last hour.
+ *
+ * @param band index
+ * @param now clock
+ * @return airtime sent
+ */
+static uint32_t bandSpent(int8_t band, uint32_t now) {
+    uint32_t spent = 0;
+    for (uint8_t i = 0; i < RFM_DC_RECORDS; i++) {
+        Airtime *record = &airtimes[i];
+        if (record->airtime > 0 && now - record->at >= 3600000UL) {
+            record->airtime = 0;
+        }
+        if (record->airtime > 0 && record->band == band) {
+            spent += record->airtime;
+        }
+    }
+
+    return spent;
+}
+
+/**
+ * Records the given airtime in ms sent now in the sub-band with the given 
+ * index. If no record is free, the airtime is added to a record of the same 
+ * sub-band, or two records of another sub-band are merged, each time moving 
+ * airtime to later, so the airtime sent is never underestimated.
+ *
+ * @param band index
+ * @param airtime sent
+ */
+static void bandRecord(int8_t band, uint32_t airtime) {
+    uint32_t now = clockUpdate();
+    bandSpent(band, now);
+
+    Airtime *free = NULL;
+    Airtime *same = NULL;
+    for (uint8_t i = 0; i < RFM_DC_RECORDS && free == NULL; i++) {
+        if (airtimes[i].airtime == 0) {
+            free = &airtimes[i];
+        } else if (airtimes[i].band == band) {
+            same = &airtimes[i];
+        }
+    }
+
+    if (free == NULL && same != NULL) {
+        same->at = now;
+        same->airtime += airtime;
+
+        return;
+    }
+
+    // more records than sub-bands, so there are two of the same sub-band
+    for (uint8_t i = 0; i < RFM_DC_RECORDS && free == NULL; i++) {
+        for (uint8_t j = i + 1; j < RFM_DC_RECORDS && free == NULL; j++) {
+            Airtime *a = &airtimes[i];
+            Airtime *b = &airtimes[j];
+            if (a->band == b->band) {
+                if (now - a->at < now - b->at) {
+                    // a is the newer one
+                    a = &airtimes[j];
+                    b = &airtimes[i];
+                }
+                b->airtime += a->airtime;
+                free = a;
+            }
+        }
+    }
+
+    free->at = now;
+    free->airtime = airtime;
+    free->band = band;
+}
+
+/**
+ * Charges the time on air of a packet with the given payload size
+ * to the sub-band of the current carrier frequency.
+ *
+ * @param size of payload
+ */
+static void bandCharge(size_t size) {
+    int8_t band = bandIndex();
+    if (band >= 0) {
+        // round up to ms
+        bandRecord(band, (rfmTimeOnAir(size) + 999) / 1000);
+    }
+}
+
+/**
+ * Returns true if sending a packet with the given payload size now would 
+ * exceed the duty cycle of the sub-band of the current carrier frequency.
+ *
+ * @param size of payload
+ * @return duty cycle exceeded
+ */
+static bool bandExceeded(size_t size) {
+    size_t max = lora ? RFM_LORA_MSG_SIZE : RFM_FSK_MSG_SIZE;
+
+    return rfmDutyCycleWait(min(size, max)) > 0;
+}
+
+#else
+
+/* Duty cycle not tracked */
+static void bandCharge(size_t size) {}
+
+static bool bandExceeded(size_t size) {
+    return false;
+}
+
+#endif /* RFM_DUTY_CYCLE */
+
 /**
  * Enables or disables timeouts in FSK mode.
  *
@@ -195,8 +698,9 @@ static bool initLoRa(void) {
     return true;
 }
 
-bool rfmInit(uint64_t freq, uint8_t node, uint8_t cast, bool _lora) {
+bool rfmInit(uint32_t freq, uint8_t node, uint8_t cast, bool _lora) {
     lora = _lora;
+    freqKHz = freq;
 
     // wait a bit after power on
     _rfmDelay5();
@@ -214,13 +718,10 @@ bool rfmInit(uint64_t freq, uint8_t node, uint8_t cast, bool _lora) {
     }
 
     // set the carrier frequency
-    uint32_t frf = freq * 1000000UL / RFM_F_STEP;
-    regWrite(RFM_FRF_MSB, frf >> 16);
-    regWrite(RFM_FRF_MID, frf >> 8);
-    regWrite(RFM_FRF_LSB, frf >> 0);
+    setFrequency(freq);
 
-    // PA level +17 dBm with PA_BOOST pin (Pmax default/not relevant)
-    regWrite(RFM_PA_CONFIG, 0xff);
+    // PA level +17 dBm with PA_BOOST pin, high power mode off
+    rfmSetOutputPower(17);
 
     // LNA highest gain, boost on, 150% LNA current
     regWrite(RFM_LNA, 0x23);
@@ -236,29 +737,167 @@ bool rfmInit(uint64_t freq, uint8_t node, uint8_t cast, bool _lora) {
         return initLoRa();
     } else {
         // FSK mode, FSK modulation, high frequency mode, sleep mode
+        modeEnter(RFM_MODE_SLEEP, _rfmMicros());
         regWrite(RFM_OP_MODE, 0x00);
 
         return initFSK(node, cast);
     }
 }
 
+/**
+ * Sets the "PacketSent"/"TxDone" flag and time stamps it if not already set.
+ *
+ * @param now time stamp
+ */
+static void txEvent(uint32_t now) {
+    if (!txDone) {
+        txDone = true;
+        txDoneTime = now;
+    }
+}
+
+/**
+ * Sets the "PayloadReady"/"RxDone" flag and time stamps it if not already set.
+ *
+ * @param now time stamp
+ */
+static void rxEvent(uint32_t now) {
+    if (!rxDone) {
+        rxDone = true;
+        rxDoneTime = now;
+    }
+}
+
+/**
+ * Sets the "ValidHeader" flag and time stamps it if not already set.
+ *
+ * @param now time stamp
+ */
+static void headerEvent(uint32_t now) {
+    if (!rxHeader) {
+        rxHeader = true;
+        rxHeaderTime = now;
+    }
+}
+
+#ifdef RFM_FSK_RX_CONTINUOUS
+
+/**
+ * Drains the FIFO into the ring buffer after "PayloadReady" in continuous 
+ * FSK receive mode, so the receiver can restart. Discards the packet if the 
+ * ring buffer is full.
+ *
+ * @param now time stamp
+ * @param irqFlags2 value of RegIrqFlags2 already read
+ */
+static void drainFSK(uint32_t now, uint8_t irqFlags2) {
+    uint8_t next = (rxHead + 1) % RFM_FSK_RX_PACKETS;
+    Packet *packet = &rxPackets[rxHead];
+
+    packet->time = now;
+    packet->rssi = divRoundNearest(regRead(RFM_FSK_RSSI_VALUE), 2);
+    packet->crc = irqFlags2 & (1 << 1);
+
+    // byte-wise since a bulk transfer might not complete in an ISR
+    _rfmSel();
+    _rfmTx(RFM_FIFO);
+    uint8_t len = min(_rfmTx(RFM_FIFO), RFM_FSK_MSG_SIZE + 1);
+    // ignore address (already filtered anyway)
+    _rfmTx(RFM_FIFO);
+    for (uint8_t i = 1; i < len; i++) {
+        packet->payload[i - 1] = _rfmTx(RFM_FIFO);
+    }
+    _rfmDes();
+    packet->len = len > 0 ? len - 1 : 0;
+
+    if (next != rxTail) {
+        rxHead = next;
+    }
+}
+
+#else
+
+/* Continuous receive mode not compiled in */
+static void drainFSK(uint32_t now, uint8_t irqFlags2) {}
+
+#endif /* RFM_FSK_RX_CONTINUOUS */
+
 void rfmIrq(void) {
+    uint32_t now = _rfmMicros();
+
     if (lora) {
         uint8_t irqFlags = regRead(RFM_LORA_IRQ_FLAGS);
+        // clear all flags that were just read
+        regWrite(RFM_LORA_IRQ_FLAGS, irqFlags);
 
         if (irqFlags & (1 << 7)) rxTimeout = true;
-        if (irqFlags & (1 << 3)) txDone = true;
-        if (irqFlags & (1 << 6)) rxDone = true;
+        if (irqFlags & (1 << 5)) rxCrcError = true;
+        if (irqFlags & (1 << 4)) headerEvent(now);
+        if (irqFlags & (1 << 3)) txEvent(now);
+        if (irqFlags & (1 << 6)) rxEvent(now);
     } else {
-        uint8_t irqFlags1 = regRead(RFM_FSK_IRQ_FLAGS1);
-        uint8_t irqFlags2 = regRead(RFM_FSK_IRQ_FLAGS2);
+        uint8_t irqFlags[2];
+        regReadBurst(RFM_FSK_IRQ_FLAGS1, irqFlags, sizeof(irqFlags));
+
+        if (irqFlags[0] & (1 << 2)) rxTimeout = true;
+        if (irqFlags[1] & (1 << 3)) txEvent(now);
+        if (irqFlags[1] & (1 << 2)) {
+            if (rxContinuous) {
+                drainFSK(now, irqFlags[1]);
+            } else {
+                rxEvent(now);
+            }
+        }
+    }
+}
 
-        if (irqFlags1 & (1 << 2)) rxTimeout = true;
-        if (irqFlags2 & (1 << 3)) txDone = true;
-        if (irqFlags2 & (1 << 2)) rxDone = true;
+void rfmIrqDio0(void) {
+    uint32_t now = _rfmMicros();
+
+    // DIO0 is mapped to "PacketSent"/"TxDone" in TX mode and to 
+    // "PayloadReady"/"RxDone" in RX modes
+    if (currentMode == RFM_MODE_TX) {
+        txEvent(now);
+    } else if (rxContinuous) {
+        drainFSK(now, regRead(RFM_FSK_IRQ_FLAGS2));
+    } else if (currentMode == RFM_MODE_RX || currentMode == RFM_MODE_RXSINGLE) {
+        rxEvent(now);
     }
 }
 
+void rfmIrqDio1(void) {
+    // DIO1 is mapped to "RxTimeout" in LoRa mode
+    if (lora) {
+        rxTimeout = true;
+    }
+}
+
+void rfmIrqDio3(void) {
+    // DIO3 is mapped to "ValidHeader" in LoRa mode
+    if (lora) {
+        headerEvent(_rfmMicros());
+    }
+}
+
+void rfmIrqDio4(void) {
+    // DIO4 is mapped to "Timeout" in FSK mode
+    if (!lora) {
+        rxTimeout = true;
+    }
+}
+
+uint32_t rfmRxDoneTime(void) {
+    return rxDoneTime;
+}
+
+uint32_t rfmTxDoneTime(void) {
+    return txDoneTime;
+}
+
+uint32_t rfmValidHeaderTime(void) {
+    return rxHeaderTime;
+}
+
 void rfmTimeout(void) {
     if (!lora) {
         // workaround for timeout interrupt sometimes not occurring in FSK mode
@@ -285,14 +924,32 @@ void rfmSetNodeAddress(uint8_t address) {
 }
 
 void rfmSetOutputPower(int8_t dBm) {
-    uint8_t pa = 0xc0; // +2 dBm with PA_BOOST
-    // adjust power from 2 to +17 dBm
-    pa |= (min(max(dBm - RFM_PA_OFF, RFM_PA_MIN), RFM_PA_MAX)) & 0x0f;
-    regWrite(RFM_PA_CONFIG, pa);
+    if (dBm < RFM_DBM_MIN) dBm = RFM_DBM_MIN;
+    if (dBm > RFM_DBM_MAX) dBm = RFM_DBM_MAX;
+
+    const uint8_t *level = paLevels[dBm - RFM_DBM_MIN];
+    regWrite(RFM_PA_CONFIG, pgm_read_byte(&level[0]));
+    regWrite(RFM_PA_DAC, pgm_read_byte(&level[1]));
+    regWrite(RFM_OCP, pgm_read_byte(&level[2]));
 }
 
 int8_t rfmGetOutputPower(void) {
-    return (regRead(RFM_PA_CONFIG) & 0x0f) + RFM_PA_OFF;
+    int8_t dBm = (regRead(RFM_PA_CONFIG) & 0x0f) + RFM_PA_OFF;
+    if ((regRead(RFM_PA_DAC) & 0x07) == 0x07) {
+        // +3 dB in high power mode
+        dBm += 3;
+    }
+
+    return dBm;
+}
+
+void rfmSetFrequency(uint32_t kHz) {
+    freqKHz = kHz;
+    setFrequency(kHz);
+}
+
+void rfmSetChannel(uint32_t base, uint32_t spacing, uint8_t channel) {
+    rfmSetFrequency(base + spacing * channel);
 }
 
 void rfmStartReceive(bool timeout) {
@@ -305,10 +962,63 @@ void rfmStartReceive(bool timeout) {
     setMode(RFM_MODE_RX);
 }
 
+#ifdef RFM_FSK_RX_CONTINUOUS
+
+void rfmStartReceiveContinuous(void) {
+    timeoutEnableFSK(false);
+
+    // AutoRestartRxMode on, wait for PLL lock
+    regWrite(RFM_FSK_SYNC_CONFIG, (regRead(RFM_FSK_SYNC_CONFIG) & ~0xc0) | 0x80);
+
+    // get "PayloadReady" on DIO0
+    regWrite(RFM_DIO_MAP1, regRead(RFM_DIO_MAP1) & ~0xc0);
+    rxHead = 0;
+    rxTail = 0;
+    rxContinuous = true;
+
+    setMode(RFM_MODE_RX);
+}
+
+void rfmStopReceiveContinuous(void) {
+    setMode(RFM_MODE_STDBY);
+    rxContinuous = false;
+
+    // AutoRestartRxMode off
+    regWrite(RFM_FSK_SYNC_CONFIG, regRead(RFM_FSK_SYNC_CONFIG) & ~0xc0);
+}
+
+size_t rfmReadContinuous(uint8_t *payload, size_t size, RxFlags *flags) {
+    flags->ready = false;
+    flags->rssi = 255;
+    flags->crc = false;
+    flags->time = 0;
+
+    if (rxTail == rxHead) {
+        return 0;
+    }
+
+    Packet *packet = &rxPackets[rxTail];
+    size_t len = min(packet->len, size);
+    for (size_t i = 0; i < len; i++) {
+        payload[i] = packet->payload[i];
+    }
+    flags->ready = true;
+    flags->rssi = packet->rssi;
+    flags->crc = packet->crc;
+    flags->time = packet->time;
+
+    rxTail = (rxTail + 1) % RFM_FSK_RX_PACKETS;
+
+    return len;
+}
+
+#endif /* RFM_FSK_RX_CONTINUOUS */
+
 RxFlags rfmPayloadReady(void) {
     RxFlags flags = {.ready = false, .rssi = 255, .crc = false};
     if (rxDone) {
         flags.ready = true;
+        flags.time = rxDoneTime;
         flags.rssi = divRoundNearest(regRead(RFM_FSK_RSSI_VALUE), 2);
         flags.crc = regRead(RFM_FSK_IRQ_FLAGS2) & (1 << 1);
         setMode(RFM_MODE_STDBY);
@@ -326,9 +1036,7 @@ size_t rfmReadPayload(uint8_t *payload, size_t size) {
 
     _rfmSel();
     _rfmTx(RFM_FIFO);
-    for (size_t i = 0; i < len; i++) {
-        payload[i] = _rfmTx(RFM_FIFO);
-    }
+    txBuf(NULL, payload, len);
     _rfmDes();
 
     return len;
@@ -353,39 +1061,91 @@ size_t rfmReceivePayload(uint8_t *payload, size_t size, bool enable) {
     return rfmReadPayload(payload, size);
 }
 
-size_t rfmTransmitPayload(uint8_t *payload, size_t size, uint8_t node) {
+/**
+ * Writes up to 63 bytes of the given payload with the given node address
+ * to the FIFO and prepares "PacketSent" in FSK mode. Returns the number
+ * of payload bytes written.
+ *
+ * @param payload to be sent
+ * @param size of payload
+ * @param node address
+ * @return payload bytes
+ */
+static size_t loadFSK(uint8_t *payload, size_t size, uint8_t node) {
     size_t len = min(size, RFM_FSK_MSG_SIZE);
 
     _rfmSel();
     _rfmTx(RFM_FIFO | 0x80);
     _rfmTx(len + 1); // +1 for node address
     _rfmTx(node);
-    for (size_t i = 0; i < len; i++) {
-        _rfmTx(payload[i]);
-    }
+    txBuf(payload, NULL, len);
     _rfmDes();
 
     // get "PacketSent" on DIO0 (default)
     regWrite(RFM_DIO_MAP1, regRead(RFM_DIO_MAP1) & ~0xc0);
     txDone = false;
 
+    return len;
+}
+
+/**
+ * Writes up to 128 bytes of the given payload to the FIFO and prepares
+ * "TxDone" in LoRa mode. Returns the number of payload bytes written.
+ *
+ * @param payload to be sent
+ * @param size of payload
+ * @return payload bytes
+ */
+static size_t loadLoRa(uint8_t *payload, size_t size) {
+    size_t len = min(size, RFM_LORA_MSG_SIZE);
+
+    // set FIFO address pointer to configured TX base address
+    regWrite(RFM_LORA_FIFO_ADDR_PTR, regRead(RFM_LORA_FIFO_TX_ADDR));
+
+    regWrite(RFM_LORA_PAYLD_LEN, len);
+
+    _rfmSel();
+    _rfmTx(RFM_FIFO | 0x80);
+    txBuf(payload, NULL, len);
+    _rfmDes();
+
+    // clear "TxDone" interrupt
+    regWrite(RFM_LORA_IRQ_FLAGS, 0x08);
+
+    // get "TxDone" on DIO0
+    regWrite(RFM_DIO_MAP1, (regRead(RFM_DIO_MAP1) & ~0x80) | 0x40);
+    txDone = false;
+
+    return len;
+}
+
+size_t rfmTransmitPayload(uint8_t *payload, size_t size, uint8_t node) {
+    if (bandExceeded(size)) {
+        return 0;
+    }
+
+    size_t len = loadFSK(payload, size, node);
+
     setMode(RFM_MODE_TX);
 
     // wait until "PacketSent"
     do {} while (!txDone);
 
     setMode(RFM_MODE_STDBY);
+    bandCharge(len);
 
     return len;
 }
 
 void rfmLoRaStartRx(void) {
-    // clear "RxDone" and "PayloadCrcError" interrupt
-    regWrite(RFM_LORA_IRQ_FLAGS, 0x40 | 0x20);
+    // clear "RxDone", "PayloadCrcError" and "ValidHeader" interrupt
+    regWrite(RFM_LORA_IRQ_FLAGS, 0x40 | 0x20 | 0x10);
     rxDone = false;
+    rxHeader = false;
+    rxCrcError = false;
 
-    // get "RxDone" on DIO0
-    regWrite(RFM_DIO_MAP1, regRead(RFM_DIO_MAP1) & ~0xc0);
+    // get "RxDone" on DIO0 and "ValidHeader" on DIO3
+    regWrite(RFM_DIO_MAP1, (regRead(RFM_DIO_MAP1) & ~0xc3) | 0x01);
 
     // set FIFO address pointer to configured RX base address
     regWrite(RFM_LORA_FIFO_ADDR_PTR, regRead(RFM_LORA_FIFO_RX_ADDR));
@@ -398,8 +1158,10 @@ RxFlags rfmLoRaRxDone(void) {
     RxFlags flags = {.ready = false, .rssi = 255, .crc = false};
     if (rxDone) {
         flags.ready = true;
+        flags.time = rxDoneTime;
         flags.rssi = 157 - regRead(RFM_LORA_PCK_RSSI);
-        flags.crc = !(regRead(RFM_LORA_IRQ_FLAGS) & (1 << 5));
+        // flag possibly already read and cleared by rfmIrq()
+        flags.crc = !(rxCrcError || regRead(RFM_LORA_IRQ_FLAGS) & (1 << 5));
     }
 
     return flags;
@@ -414,9 +1176,7 @@ size_t rfmLoRaRxRead(uint8_t *payload, size_t size) {
 
     _rfmSel();
     _rfmTx(RFM_FIFO);
-    for (size_t i = 0; i < len; i++) {
-        payload[i] = _rfmTx(RFM_FIFO);
-    }
+    txBuf(NULL, payload, len);
     _rfmDes();
 
     return len;
@@ -430,6 +1190,7 @@ size_t rfmLoRaRx(uint8_t *payload, size_t size) {
     regWrite(RFM_DIO_MAP1, regRead(RFM_DIO_MAP1) & ~0xf0);
     rxTimeout = false;
     rxDone = false;
+    rxCrcError = false;
 
     // set FIFO address pointer to configured TX base address
     regWrite(RFM_LORA_FIFO_ADDR_PTR, regRead(RFM_LORA_FIFO_RX_ADDR));
@@ -439,6 +1200,9 @@ size_t rfmLoRaRx(uint8_t *payload, size_t size) {
     // wait until "RxDone" or "RxTimeout"
     do {} while (!rxDone && !rxTimeout);
 
+    // radio went to standby by itself
+    modeEnter(RFM_MODE_STDBY, rxDone ? rxDoneTime : _rfmMicros());
+
     if (rxTimeout) {
         return 0;
     }
@@ -447,31 +1211,436 @@ size_t rfmLoRaRx(uint8_t *payload, size_t size) {
 }
 
 size_t rfmLoRaTx(uint8_t *payload, size_t size) {
-    size_t len = min(size, RFM_LORA_MSG_SIZE);
+    if (bandExceeded(size)) {
+        return 0;
+    }
 
-    // set FIFO address pointer to configured TX base address
-    regWrite(RFM_LORA_FIFO_ADDR_PTR, regRead(RFM_LORA_FIFO_TX_ADDR));
+    size_t len = loadLoRa(payload, size);
 
-    regWrite(RFM_LORA_PAYLD_LEN, len);
+    setMode(RFM_MODE_TX);
 
-    _rfmSel();
-    _rfmTx(RFM_FIFO | 0x80);
-    for (size_t i = 0; i < len; i++) {
-        _rfmTx(payload[i]);
+    // wait until "TxDone"
+    do {} while (!txDone);
+
+    // radio went to standby by itself
+    modeEnter(RFM_MODE_STDBY, txDoneTime);
+    bandCharge(len);
+
+    return len;
+}
+
+/**
+ * Returns the time on air in microseconds of a packet with the given
+ * payload size in FSK mode (variable length with node address).
+ *
+ * @param size of payload
+ * @return time on air
+ */
+static uint32_t timeOnAirFSK(size_t size) {
+    uint16_t bitrate = (regRead(RFM_FSK_BITRATE_MSB) << 8) |
+            regRead(RFM_FSK_BITRATE_LSB);
+    uint16_t preamble = (regRead(RFM_FSK_PREA_MSB) << 8) |
+            regRead(RFM_FSK_PREA_LSB);
+    uint8_t syncConfig = regRead(RFM_FSK_SYNC_CONFIG);
+    uint8_t sync = (syncConfig & 0x10) ? (syncConfig & 0x07) + 1 : 0;
+    uint8_t crc = (regRead(RFM_FSK_PCK_CONFIG1) & 0x10) ? 2 : 0;
+
+    // +1 for length byte, +1 for node address
+    uint32_t bytes = preamble + sync + 2 + min(size, RFM_FSK_MSG_SIZE) + crc;
+
+    // bit time in µs is bitrate register / FXOSC (32 MHz)
+    return (bytes * 8 * bitrate) >> 5;
+}
+
+/**
+ * Returns the time on air in microseconds of a packet with the given
+ * payload size in LoRa mode (AN1200.13).
+ *
+ * @param size of payload
+ * @return time on air
+ */
+static uint32_t timeOnAirLoRa(size_t size) {
+    uint8_t config1 = regRead(RFM_LORA_MODEM_CONFIG1);
+    uint8_t config2 = regRead(RFM_LORA_MODEM_CONFIG2);
+    uint8_t config3 = regRead(RFM_LORA_MODEM_CONFIG3);
+    uint16_t preamble = (regRead(RFM_LORA_PREA_LEN_MSB) << 8) |
+            regRead(RFM_LORA_PREA_LEN_LSB);
+
+    uint8_t bw = min(config1 >> 4, array_length(loRaBandwidths) - 1);
+    uint8_t cr = (config1 >> 1) & 0x07;
+    uint8_t ih = config1 & 0x01;
+    uint8_t sf = max(config2 >> 4, 6);
+    uint8_t crc = (config2 >> 2) & 0x01;
+    uint8_t de = (config3 >> 3) & 0x01;
+
+    uint32_t symbol = (1000000UL << sf) / pgm_read_dword(&loRaBandwidths[bw]);
+
+    int16_t bits = 8 * min(size, RFM_LORA_MSG_SIZE) - 4 * sf + 28 +
+            16 * crc - 20 * ih;
+    int16_t div = 4 * (sf - 2 * de);
+    uint32_t payload = 8;
+    if (bits > 0) {
+        payload += (bits + div - 1) / div * (cr + 4);
     }
-    _rfmDes();
 
-    // clear "TxDone" interrupt
-    regWrite(RFM_LORA_IRQ_FLAGS, 0x08);
+    // preamble + 4.25 + payload symbols, in quarter symbols
+    uint32_t quarters = 4UL * preamble + 17 + 4 * payload;
 
-    // get "TxDone" on DIO0
-    regWrite(RFM_DIO_MAP1, (regRead(RFM_DIO_MAP1) & ~0x80) | 0x40);
-    txDone = false;
+    return (quarters >> 2) * symbol + (((quarters & 0x03) * symbol) >> 2);
+}
 
-    setMode(RFM_MODE_TX);
+uint32_t rfmTimeOnAir(size_t size) {
+    return lora ? timeOnAirLoRa(size) : timeOnAirFSK(size);
+}
 
-    // wait until "TxDone"
+bool rfmTdmaInit(Tdma _tdma) {
+    tdmaSynced = false;
+    if (_tdma.slot == 0 ||
+            _tdma.offset + (_tdma.index + 1UL) * _tdma.slot > _tdma.frame) {
+        tdma.frame = 0;
+
+        return false;
+    }
+    tdma = _tdma;
+
+    return true;
+}
+
+void rfmTdmaSync(uint32_t time, size_t size) {
+    tdmaBeacon = time - rfmTimeOnAir(size);
+    tdmaSynced = true;
+}
+
+size_t rfmTdmaTransmit(uint8_t *payload, size_t size, uint8_t node) {
+    if (!tdmaSynced || tdma.frame == 0) {
+        return 0;
+    }
+
+    uint32_t toa = rfmTimeOnAir(size);
+    if (toa + 2 * tdma.guard > tdma.slot || bandExceeded(size)) {
+        return 0;
+    }
+
+    size_t len = lora ? loadLoRa(payload, size) : loadFSK(payload, size, node);
+    uint8_t opMode = (regRead(RFM_OP_MODE) & ~RFM_MASK_MODE) | RFM_MODE_TX;
+
+    // start of the own slot in the current or the next frame(s)
+    uint32_t start = tdma.offset + tdma.index * tdma.slot + tdma.guard;
+    uint32_t elapsed = _rfmMicros() - tdmaBeacon + RFM_TS_TX;
+    uint32_t frames = 0;
+    if (elapsed > start) {
+        frames = (elapsed - start) / tdma.frame + 1;
+    }
+    uint32_t at = tdmaBeacon + start + frames * tdma.frame - RFM_TS_TX;
+
+    // account before waiting to not delay TX
+    modeEnter(RFM_MODE_TX, at);
+
+    // wait until the slot starts, wrap-around safe
+    do {} while ((int32_t)(_rfmMicros() - at) < 0);
+
+    regWrite(RFM_OP_MODE, opMode);
+
+    // wait until "PacketSent"/"TxDone"
     do {} while (!txDone);
 
+    if (lora) {
+        modeEnter(RFM_MODE_STDBY, txDoneTime);
+    } else {
+        setMode(RFM_MODE_STDBY);
+    }
+    bandCharge(len);
+
+    return len;
+}
+
+#ifdef RFM_DUTY_CYCLE
+
+uint32_t rfmDutyCycleBudget(void) {
+    int8_t band = bandIndex();
+    if (band < 0) {
+        return UINT32_MAX;
+    }
+
+    uint32_t spent = bandSpent(band, clockUpdate());
+    uint32_t limit = bandLimit(band);
+
+    return (limit - min(spent, limit)) * 1000;
+}
+
+uint32_t rfmDutyCycleWait(size_t size) {
+    int8_t band = bandIndex();
+    if (band < 0) {
+        return 0;
+    }
+
+    uint32_t now = clockUpdate();
+    uint32_t spent = bandSpent(band, now);
+    uint32_t limit = bandLimit(band);
+    uint32_t airtime = (rfmTimeOnAir(size) + 999) / 1000;
+
+    if (spent + airtime <= limit) {
+        return 0;
+    }
+    if (airtime > limit) {
+        return UINT32_MAX;
+    }
+
+    // wait until enough of the oldest airtime sent is older than one hour
+    uint32_t needed = spent + airtime - limit;
+    uint32_t freed = 0;
+    uint32_t age = UINT32_MAX;
+    while (freed < needed) {
+        // age of the next oldest record(s)
+        uint32_t next = 0;
+        for (uint8_t i = 0; i < RFM_DC_RECORDS; i++) {
+            Airtime *record = &airtimes[i];
+            uint32_t recordAge = now - record->at;
+            if (record->airtime > 0 && record->band == band &&
+                    recordAge < age && recordAge >= next) {
+                next = recordAge;
+            }
+        }
+        age = next;
+        for (uint8_t i = 0; i < RFM_DC_RECORDS; i++) {
+            Airtime *record = &airtimes[i];
+            if (record->airtime > 0 && record->band == band &&
+                    now - record->at == age) {
+                freed += record->airtime;
+            }
+        }
+    }
+
+    return (3600000UL - age) * 1000;
+}
+
+bool rfmQueueAdd(uint8_t *payload, size_t size, uint8_t node, 
+                 uint8_t prio, bool coalesce) {
+    if (queueLen == RFM_QUEUE_SIZE) {
+        return false;
+    }
+
+    // keep the queue ordered by priority, first in first out for same
+    size_t max = (lora ? RFM_LORA_MSG_SIZE : RFM_FSK_MSG_SIZE) - coalesce;
+    uint8_t i = queueLen;
+    for (; i > 0 && queue[i - 1].prio < prio; i--) {
+        queue[i] = queue[i - 1];
+    }
+    queue[i] = (Message){payload, min(size, max), node, prio, 
+                         coalesce};
+    queueLen++;
+
+    return true;
+}
+
+uint8_t rfmQueueLength(void) {
+    return queueLen;
+}
+
+/**
+ * Packs the first message and following coalescable messages with the same
+ * node address, as far as they fit in one packet and the given airtime, 
+ * length-prefixed into the frame buffer and returns its size. Flags the 
+ * packed messages in the given array.
+ *
+ * @param airtime available
+ * @param packed messages
+ * @return size of frame
+ */
+static size_t queuePack(uint32_t airtime, bool *packed) {
+    size_t max = lora ? RFM_LORA_MSG_SIZE : RFM_FSK_MSG_SIZE;
+    size_t len = 0;
+
+    for (uint8_t i = 0; i < queueLen; i++) {
+        Message *msg = &queue[i];
+        if (!msg->coalesce || msg->node != queue[0].node) {
+            continue;
+        }
+        size_t next = len + 1 + msg->size;
+        if (next > max || rfmTimeOnAir(next) > airtime) {
+            break;
+        }
+        queueFrame[len] = msg->size;
+        for (uint8_t j = 0; j < msg->size; j++) {
+            queueFrame[len + 1 + j] = msg->payload[j];
+        }
+        len = next;
+        packed[i] = true;
+    }
+
+    return len;
+}
+
+uint8_t rfmQueueSend(void) {
+    if (queueLen == 0) {
+        return 0;
+    }
+
+    uint32_t airtime = rfmDutyCycleBudget();
+    bool packed[RFM_QUEUE_SIZE] = {false};
+    uint8_t *payload = queue[0].payload;
+    size_t size = queue[0].size;
+
+    if (queue[0].coalesce) {
+        payload = queueFrame;
+        size = queuePack(airtime, packed);
+        if (size == 0) {
+            return 0;
+        }
+    } else if (rfmTimeOnAir(size) > airtime) {
+        return 0;
+    } else {
+        packed[0] = true;
+    }
+
+    if (lora) {
+        rfmLoRaTx(payload, size);
+    } else {
+        rfmTransmitPayload(payload, size, queue[0].node);
+    }
+
+    // remove the sent messages
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < queueLen; i++) {
+        if (packed[i]) {
+            sent++;
+        } else {
+            queue[i - sent] = queue[i];
+        }
+    }
+    queueLen -= sent;
+
+    return sent;
+}
+
+uint32_t rfmQueueWait(void) {
+    if (queueLen == 0) {
+        return 0;
+    }
+
+    // at least the first message, with length prefix if coalescable
+    return rfmDutyCycleWait(queue[0].size + queue[0].coalesce);
+}
+
+#endif /* RFM_DUTY_CYCLE */
+
+uint8_t *rfmUnpack(uint8_t *frame, size_t size, size_t *offset, size_t *len) {
+    if (*offset >= size || *offset + 1 + frame[*offset] > size) {
+        return NULL;
+    }
+
+    uint8_t *msg = &frame[*offset + 1];
+    *len = frame[*offset];
+    *offset += 1 + *len;
+
+    return msg;
+}
+
+void rfmScan(uint32_t from, uint32_t step, uint8_t *rssi, size_t count) {
+    uint8_t frf[3];
+    regReadBurst(RFM_FRF_MSB, frf, sizeof(frf));
+
+    if (lora) {
+        for (size_t i = 0; i < count; i++) {
+            // only change the frequency in standby mode
+            setMode(RFM_MODE_STDBY);
+            setFrequency(from + i * step);
+            setMode(RFM_MODE_RX);
+            waitMicros(RFM_TS_FS + RFM_LORA_TS_RSSI);
+            rssi[i] = 157 - regRead(RFM_LORA_RSSI);
+        }
+    } else {
+        uint32_t settle = RFM_TS_FS + rssiTimeFSK();
+        uint8_t rxConfig = regRead(RFM_FSK_RX_CONFIG);
+
+        timeoutEnableFSK(false);
+        setMode(RFM_MODE_RX);
+        for (size_t i = 0; i < count; i++) {
+            setFrequency(from + i * step);
+            // restart the receiver waiting for the PLL to lock
+            regWrite(RFM_FSK_RX_CONFIG, rxConfig | 0x20);
+            waitMicros(settle);
+            rssi[i] = divRoundNearest(regRead(RFM_FSK_RSSI_VALUE), 2);
+        }
+    }
+
+    setMode(RFM_MODE_STDBY);
+    regWriteBurst(RFM_FRF_MSB, frf, sizeof(frf));
+}
+
+void rfmTick(void) {
+    clockUpdate();
+    modeEnter(currentMode, _rfmMicros());
+}
+
+#ifdef RFM_ENERGY
+
+void rfmEnergyReset(void) {
+    modeEnter(currentMode, _rfmMicros());
+    for (uint8_t i = 0; i < array_length(modeTime); i++) {
+        modeTime[i] = 0;
+        modeTimeMicros[i] = 0;
+    }
+    chargeMicro = 0;
+    chargeNano = 0;
+    chargePico = 0;
+}
+
+uint32_t rfmEnergyTime(uint8_t mode) {
+    modeEnter(currentMode, _rfmMicros());
+
+    return modeTime[mode & RFM_MASK_MODE];
+}
+
+uint32_t rfmEnergyCharge(void) {
+    modeEnter(currentMode, _rfmMicros());
+
+    return chargeMicro;
+}
+
+#endif /* RFM_ENERGY */
+
+void rfmLoRaSetPreamble(uint16_t length) {
+    regWrite(RFM_LORA_PREA_LEN_MSB, length >> 8);
+    regWrite(RFM_LORA_PREA_LEN_LSB, length);
+}
+
+RxDutyCycle rfmLoRaRxDutyCycle(uint16_t preamble) {
+    RxDutyCycle dc = {.window = RFM_LORA_RX_WINDOW, .sleep = 0};
+
+    uint8_t sf = max(regRead(RFM_LORA_MODEM_CONFIG2) >> 4, 6);
+    uint8_t bw = min(regRead(RFM_LORA_MODEM_CONFIG1) >> 4, 
+            array_length(loRaBandwidths) - 1);
+    uint32_t symbol = (1000000UL << sf) / pgm_read_dword(&loRaBandwidths[bw]);
+
+    // one full window must fall within the preamble, one symbol to wake up
+    if (preamble > 2 * dc.window + 1) {
+        uint32_t symbols = preamble - 2 * dc.window - 1;
+        // shorter than possible does not miss the preamble
+        dc.sleep = symbols > UINT32_MAX / symbol ? UINT32_MAX : symbols * symbol;
+    }
+
+    rfmLoRaSetPreamble(preamble);
+
+    return dc;
+}
+
+size_t rfmLoRaRxWindow(uint8_t *payload, size_t size, RxDutyCycle dc) {
+    uint8_t config2 = regRead(RFM_LORA_MODEM_CONFIG2);
+    uint8_t timeout = regRead(RFM_LORA_SYMB_TIMEO_LSB);
+
+    // RX timeout in symbols, 10 bits
+    regWrite(RFM_LORA_MODEM_CONFIG2, (config2 & ~0x03) | ((dc.window >> 8) & 0x03));
+    regWrite(RFM_LORA_SYMB_TIMEO_LSB, dc.window);
+
+    size_t len = rfmLoRaRx(payload, size);
+
+    regWrite(RFM_LORA_MODEM_CONFIG2, config2);
+    regWrite(RFM_LORA_SYMB_TIMEO_LSB, timeout);
+
+    if (len == 0 && !rxDone) {
+        setMode(RFM_MODE_SLEEP);
+    }
+
     return len;
 }
@@ -25,6 +25,7 @@
 #define RFM_DIO_MAP1            0x40
 #define RFM_DIO_MAP2            0x41
 #define RFM_VERSION             0x42
+#define RFM_PA_DAC              0x4d
 
 /* FSK mode registers */
 #define RFM_FSK_BITRATE_MSB     0x02
@@ -110,18 +111,54 @@
 
 #define RFM_F_STEP              61035
 
+/**
+ * Converts the given frequency in kHz (up to 4294967) to the value of the 
+ * RegFrf registers, equal to kHz * 1000000 / RFM_F_STEP but with 32-bit 
+ * arithmetic only. Evaluated at compile time for constants.
+ */
+#define RFM_FRF(kHz) \
+    ((uint32_t)(kHz) * 1000u / RFM_F_STEP * 1000u + \
+    (uint32_t)(kHz) * 1000u % RFM_F_STEP * 1000u / RFM_F_STEP)
+
 #define RFM_DBM_MIN             2
-#define RFM_DBM_MAX             17
-#define RFM_PA_MIN              0
-#define RFM_PA_MAX              15
+#define RFM_DBM_MAX             20
 #define RFM_PA_OFF              2
 
+// standby to TX in microseconds (TS_FS + TS_TR with 40 µs PA ramp)
+#define RFM_TS_TX               120
+// frequency synthesizer wake-up/PLL lock in microseconds
+#define RFM_TS_FS               60
+
 /* FSK mode values */
 #define RFM_FSK_MSG_SIZE        63
+// continuous receive mode, opt-in with -DRFM_FSK_RX_CONTINUOUS
+#ifdef RFM_FSK_RX_CONTINUOUS
+// packets buffered in continuous receive mode, one less is usable
+#ifndef RFM_FSK_RX_PACKETS
+#define RFM_FSK_RX_PACKETS      3
+#endif
+#endif
 
 /* LoRa mode values */
 // assuming 50/50 for Tx/Rx for now
 #define RFM_LORA_MSG_SIZE       128
+// conservative RX startup and RSSI settling in microseconds
+#define RFM_LORA_TS_RSSI        1000
+// RX window in symbols when duty cycling, enough to detect the preamble
+#define RFM_LORA_RX_WINDOW      8
+
+/* Duty cycle tracking and send queue, opt-in with -DRFM_DUTY_CYCLE */
+#ifdef RFM_DUTY_CYCLE
+// airtime records of the last hour, more than sub-bands
+#ifndef RFM_DC_RECORDS
+#define RFM_DC_RECORDS          16
+#endif
+
+// send queue
+#ifndef RFM_QUEUE_SIZE
+#define RFM_QUEUE_SIZE          8
+#endif
+#endif
 
 /**
  * Flags for 'PayloadReady'/'RxDone' event.
@@ -130,8 +167,29 @@ typedef struct {
     bool ready;
     bool crc;
     uint8_t rssi;
+    uint32_t time; // "PayloadReady"/"RxDone" time stamp
 } RxFlags;
 
+/**
+ * TDMA frame configuration, times in microseconds.
+ * Slots follow each other after 'offset' from the start of the beacon.
+ */
+typedef struct {
+    uint32_t frame;  // beacon start to next beacon start
+    uint32_t offset; // beacon start to start of the first slot
+    uint32_t slot;   // length of one slot
+    uint32_t guard;  // kept free at the start and end of a slot
+    uint8_t index;   // own slot
+} Tdma;
+
+/**
+ * RX duty cycle profile.
+ */
+typedef struct {
+    uint16_t window; // RX window in symbols
+    uint32_t sleep;  // sleep time between windows in microseconds
+} RxDutyCycle;
+
 /**
  * F_CPU dependent delay of 5 milliseconds.
  * _delay_ms(5);
@@ -164,6 +222,39 @@ void _rfmDes(void);
  */
 uint8_t _rfmTx(uint8_t data);
 
+/**
+ * Starts transmitting/receiving the given number of bytes via SPI, i.e. 
+ * interrupt or DMA driven, and calls rfmTxBufDone() when done. If 'out'
+ * is NULL, 0x00 is transmitted, if 'in' is NULL, received data is discarded.
+ * Used for FIFO transfers. Optional, the library provides a weak default 
+ * using _rfmTx().
+ * The library still waits for rfmTxBufDone() before it continues, since the
+ * radio must stay selected until the transfer is complete and what follows
+ * (starting TX, reading the next packet) depends on it. So the benefit is
+ * a faster transfer, not the CPU being free in the meantime.
+ * 
+ * @param out data to transmit or NULL
+ * @param in buffer for received data or NULL
+ * @param len number of bytes
+ */
+void _rfmTxBuf(const uint8_t *out, uint8_t *in, size_t len);
+
+/**
+ * Returns a free running time stamp in microseconds, used to time stamp
+ * interrupts, to time transmissions and to track airtime and energy.
+ * Must keep running while the radio is used.
+ * return (overflows << 16) | TCNT1; // timer1 at 1 MHz
+ *
+ * @return time stamp
+ */
+uint32_t _rfmMicros(void);
+
+/**
+ * Signals completion of a transfer started with _rfmTxBuf().
+ * Can be called from an interrupt.
+ */
+void rfmTxBufDone(void);
+
 /**
  * Initializes the radio module in FSK or LoRa mode with the given carrier 
  * frequency in kilohertz and node and brodcast address. 
@@ -175,14 +266,64 @@ uint8_t _rfmTx(uint8_t data);
  * @param lora LoRa or FSK mode
  * @return success
  */
-bool rfmInit(uint64_t freq, uint8_t node, uint8_t cast, bool lora);
+bool rfmInit(uint32_t freq, uint8_t node, uint8_t cast, bool lora);
 
 /**
- * Reads interrupt flags. Should be called when any interrupt occurs 
- * on DIO0 or DIO4 (FSK)/DIO1 (LoRa).
+ * Reads interrupt flags and time stamps them. Should be called when any 
+ * interrupt occurs on DIO0 or DIO4 (FSK)/DIO1 (LoRa), and optionally 
+ * DIO3 (LoRa "ValidHeader").
  */
 void rfmIrq(void);
 
+/**
+ * Handles an interrupt on DIO0 ("PayloadReady"/"PacketSent" in FSK mode,
+ * "RxDone"/"TxDone" in LoRa mode), inferring the event from the current 
+ * operating mode without any SPI transfer, except for reading the FIFO in 
+ * continuous FSK receive mode.
+ * Alternative to rfmIrq().
+ */
+void rfmIrqDio0(void);
+
+/**
+ * Handles an interrupt on DIO1 ("RxTimeout") without any SPI transfer.
+ * For LoRa mode, alternative to rfmIrq().
+ */
+void rfmIrqDio1(void);
+
+/**
+ * Handles an interrupt on DIO3 ("ValidHeader") without any SPI transfer.
+ * For LoRa mode, alternative to rfmIrq().
+ */
+void rfmIrqDio3(void);
+
+/**
+ * Handles an interrupt on DIO4 ("Timeout") without any SPI transfer.
+ * For FSK mode, alternative to rfmIrq().
+ */
+void rfmIrqDio4(void);
+
+/**
+ * Returns the time stamp of the last "PayloadReady"/"RxDone" interrupt.
+ * 
+ * @return time stamp
+ */
+uint32_t rfmRxDoneTime(void);
+
+/**
+ * Returns the time stamp of the last "PacketSent"/"TxDone" interrupt.
+ * 
+ * @return time stamp
+ */
+uint32_t rfmTxDoneTime(void);
+
+/**
+ * Returns the time stamp of the last "ValidHeader" interrupt.
+ * For LoRa mode.
+ * 
+ * @return time stamp
+ */
+uint32_t rfmValidHeaderTime(void);
+
 /**
  * Sets the "Timeout" interrupt flag, allowing to "unlock" a possibly hanging 
  * wait for either "PayloadReady" or "Timeout" by the radio in FSK mode, 
@@ -208,8 +349,9 @@ void rfmWake(void);
 void rfmSetNodeAddress(uint8_t address);
 
 /**
- * Sets the output power to +2 to +17 dBm. 
- * Values outside that range are ignored.
+ * Sets the output power to +2 to +17 dBm, or +18 to +20 dBm in high power
+ * mode, with over current protection raised accordingly. 
+ * Values outside that range are clamped.
  * 
  * @param dBm ouput power
  */
@@ -222,6 +364,23 @@ void rfmSetOutputPower(int8_t dBm);
  */
 int8_t rfmGetOutputPower(void);
 
+/**
+ * Sets the carrier frequency in kilohertz.
+ * 
+ * @param kHz carrier frequency
+ */
+void rfmSetFrequency(uint32_t kHz);
+
+/**
+ * Sets the carrier frequency to the given channel, with the given base
+ * frequency of channel 0 and channel spacing in kilohertz.
+ * 
+ * @param base frequency of channel 0
+ * @param spacing channel spacing
+ * @param channel
+ */
+void rfmSetChannel(uint32_t base, uint32_t spacing, uint8_t channel);
+
 /**
  * Sets the radio to receive mode and maps "PayloadReady" to DIO0 and enables
  * or disables timeout.
@@ -231,6 +390,39 @@ int8_t rfmGetOutputPower(void);
  */
 void rfmStartReceive(bool timeout);
 
+#ifdef RFM_FSK_RX_CONTINUOUS
+
+/**
+ * Sets the radio to continuous receive mode with AutoRestartRx, maps 
+ * "PayloadReady" to DIO0 and disables timeout. Received packets are read 
+ * from the FIFO in the interrupt path (also by rfmIrqDio0()), so the radio
+ * never leaves receive mode between packets.
+ * For FSK mode.
+ */
+void rfmStartReceiveContinuous(void);
+
+/**
+ * Stops continuous receive mode and puts the radio in standby mode.
+ * For FSK mode.
+ */
+void rfmStopReceiveContinuous(void);
+
+/**
+ * Puts the oldest packet received in continuous receive mode into the given 
+ * array with the given size, sets the given flags including the time stamp 
+ * of its reception, and returns the length of the payload, or 0 if no packet 
+ * was received. Does not change rfmRxDoneTime().
+ * For FSK mode.
+ * 
+ * @param payload buffer for payload
+ * @param size of payload buffer
+ * @param flags of received packet
+ * @return payload bytes actually received
+ */
+size_t rfmReadContinuous(uint8_t *payload, size_t size, RxFlags *flags);
+
+#endif /* RFM_FSK_RX_CONTINUOUS */
+
 /**
  * Returns true and puts the radio in standby mode if a "PayloadReady" 
  * interrupt arrived.
@@ -266,6 +458,8 @@ size_t rfmReceivePayload(uint8_t *payload, size_t size, bool timeout);
 
 /**
  * Transmits up to 63 bytes of the given payload with the given node address.
+ * Returns 0 without transmitting if the duty cycle tracked with 
+ * RFM_DUTY_CYCLE does not allow it.
  * For FSK mode.
  * 
  * @param payload to be sent
@@ -310,6 +504,8 @@ size_t rfmLoRaRx(uint8_t *payload, size_t size);
 
 /**
  * Transmits up to 128 bytes of the given payload.
+ * Returns 0 without transmitting if the duty cycle tracked with 
+ * RFM_DUTY_CYCLE does not allow it.
  * 
  * @param payload to be sent
  * @param size of payload
@@ -317,4 +513,214 @@ size_t rfmLoRaRx(uint8_t *payload, size_t size);
  */
 size_t rfmLoRaTx(uint8_t *payload, size_t size);
 
+/**
+ * Returns the time on air in microseconds of a packet with the given 
+ * payload size with the current modem configuration (FSK or LoRa).
+ * 
+ * @param size of payload
+ * @return time on air
+ */
+uint32_t rfmTimeOnAir(size_t size);
+
+/**
+ * Sets the TDMA frame configuration. Returns false and leaves TDMA
+ * unconfigured if the own slot does not end within the frame.
+ * 
+ * @param tdma frame configuration
+ * @return true if the configuration is valid
+ */
+bool rfmTdmaInit(Tdma tdma);
+
+/**
+ * Synchronizes the TDMA frame to the beacon with the given payload size
+ * that was received at the given "PayloadReady"/"RxDone" time stamp
+ * (RxFlags.time).
+ * 
+ * @param time stamp of beacon reception
+ * @param size of beacon payload
+ */
+void rfmTdmaSync(uint32_t time, size_t size);
+
+/**
+ * Waits for the start of the own slot and transmits the given payload 
+ * with the given node address (FSK only), so that transmission starts 
+ * exactly at the start of the slot plus guard time. Returns 0 without 
+ * transmitting if not configured or synchronized, if the packet does not 
+ * fit in a slot, or if the duty cycle tracked with RFM_DUTY_CYCLE does 
+ * not allow it.
+ * 
+ * @param payload to be sent
+ * @param size of payload
+ * @param node address
+ * @return payload bytes actually sent
+ */
+size_t rfmTdmaTransmit(uint8_t *payload, size_t size, uint8_t node);
+
+#ifdef RFM_DUTY_CYCLE
+
+/**
+ * Returns the airtime in microseconds currently available in the regulated 
+ * sub-band (EU433/EU868) of the carrier frequency, or UINT32_MAX if the 
+ * frequency is not in a regulated sub-band. The time on air of each packet
+ * sent is recorded for its sub-band, and the airtime available is the 
+ * budget for one hour given by the duty cycle of the sub-band minus the 
+ * airtime sent during the last hour. Transmit functions refuse packets
+ * exceeding it. Airtime sent before the MCU was reset is not known.
+ * 
+ * @return airtime available
+ */
+uint32_t rfmDutyCycleBudget(void);
+
+/**
+ * Returns the time in microseconds until a packet with the given payload
+ * size can be sent without exceeding the duty cycle, or 0 if it can be sent
+ * right away.
+ * 
+ * @param size of payload
+ * @return time to wait
+ */
+uint32_t rfmDutyCycleWait(size_t size);
+
+/**
+ * Adds the given payload with the given node address (FSK only) and 
+ * priority to the send queue. Messages with higher priority are sent first.
+ * Coalescable messages are sent length-prefixed, packed together with 
+ * following coalescable messages with the same node address as far as they 
+ * fit in one packet, see rfmUnpack().
+ * The payload must remain valid until it is sent.
+ * Returns false if the queue is full.
+ * 
+ * @param payload to be sent
+ * @param size of payload
+ * @param node address
+ * @param prio priority
+ * @param coalesce coalescable
+ * @return success
+ */
+bool rfmQueueAdd(uint8_t *payload, size_t size, uint8_t node, 
+                 uint8_t prio, bool coalesce);
+
+/**
+ * Returns the number of messages in the send queue.
+ * 
+ * @return messages queued
+ */
+uint8_t rfmQueueLength(void);
+
+/**
+ * Sends the next message(s) in the send queue if the duty cycle allows,
+ * and returns the number of messages sent.
+ * 
+ * @return messages sent
+ */
+uint8_t rfmQueueSend(void);
+
+/**
+ * Returns the time in microseconds until the next message in the send queue
+ * can be sent, or 0 if it can be sent right away.
+ * 
+ * @return time to wait
+ */
+uint32_t rfmQueueWait(void);
+
+#endif /* RFM_DUTY_CYCLE */
+
+/**
+ * Returns the next message at the given offset of the given received frame 
+ * of coalesced messages, sets its length and advances the offset, or returns 
+ * NULL if there are no more messages.
+ * 
+ * @param frame received
+ * @param size of frame
+ * @param offset of next message
+ * @param len of message
+ * @return message
+ */
+uint8_t *rfmUnpack(uint8_t *frame, size_t size, size_t *offset, size_t *len);
+
+/**
+ * Measures the RSSI on the given number of channels starting at the given 
+ * frequency in kHz with the given spacing in kHz, and puts the values, 
+ * positive like in RxFlags, into the given array. In FSK mode, waits as 
+ * long as the RSSI sampling configured in RegRssiConfig takes per channel.
+ * Restores the carrier frequency and puts the radio in standby mode when done.
+ * 
+ * @param from frequency of first channel
+ * @param step channel spacing
+ * @param rssi buffer for RSSI values
+ * @param count number of channels
+ */
+void rfmScan(uint32_t from, uint32_t step, uint8_t *rssi, size_t count);
+
+/**
+ * Keeps track of time since _rfmMicros() wraps around after 71 minutes.
+ * Must be called at least every 71 minutes if no other function of the 
+ * library is called in the meantime, i.e. while the radio sleeps.
+ */
+void rfmTick(void);
+
+#ifdef RFM_ENERGY
+
+/**
+ * Resets the time spent in each operating mode and the estimated charge.
+ */
+void rfmEnergyReset(void);
+
+/**
+ * Returns the time in milliseconds spent in the given operating mode 
+ * since the last reset.
+ * 
+ * @param mode operating mode
+ * @return time spent
+ */
+uint32_t rfmEnergyTime(uint8_t mode);
+
+/**
+ * Returns the charge in µC (µAs) consumed since the last reset, estimated
+ * from the time spent in each operating mode and the typical supply current 
+ * of the mode, with the current output power in TX mode. 
+ * Divide by 3600 for µAh.
+ * 
+ * @return charge consumed
+ */
+uint32_t rfmEnergyCharge(void);
+
+#endif /* RFM_ENERGY */
+
+/**
+ * Sets the preamble length in symbols.
+ * For LoRa mode.
+ * 
+ * @param length preamble length
+ */
+void rfmLoRaSetPreamble(uint16_t length);
+
+/**
+ * Sets the given preamble length, which the sender must use as well, and 
+ * returns an RX duty cycle profile where the sleep time between two RX
+ * windows is as long as possible without missing the preamble, but at 
+ * most UINT32_MAX.
+ * A longer preamble means longer sleep and less charge consumed, but 
+ * a higher latency and longer time on air.
+ * For LoRa mode.
+ * 
+ * @param preamble length in symbols
+ * @return profile
+ */
+RxDutyCycle rfmLoRaRxDutyCycle(uint16_t preamble);
+
+/**
+ * Receives during the RX window of the given profile like rfmLoRaRx(),
+ * and puts the radio to sleep if nothing was received. The application
+ * should then sleep for the sleep time of the profile before calling 
+ * this function again.
+ * For LoRa mode.
+ * 
+ * @param payload buffer for payload
+ * @param size of payload buffer
+ * @param dc RX duty cycle profile
+ * @return payload bytes actually received
+ */
+size_t rfmLoRaRxWindow(uint8_t *payload, size_t size, RxDutyCycle dc);
+
 #endif /* LIBRFM95_H */
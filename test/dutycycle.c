@@ -0,0 +1,153 @@
+/*
+ * File:   dutycycle.c
+ *
+ * Host test verifying that the airtime sent per sub-band is recorded and
+ * merged without underestimating it, that transmission is refused when the
+ * duty cycle is exceeded, and that rfmDutyCycleWait() finds the oldest
+ * record(s) to wait for.
+ */
+
+#include <stdio.h>
+#include "librfm95.h"
+#include "radio.h"
+
+/* 1% in 868.0-868.6 MHz, 10% in 869.4-869.65 MHz, in ms per hour */
+#define LIMIT_868       36000UL
+#define LIMIT_869       360000UL
+
+static uint8_t payload[RFM_LORA_MSG_SIZE];
+
+/**
+ * Advances the clock by the given number of milliseconds, letting the
+ * library keep track of time at least every minute.
+ */
+static void advance(uint32_t ms) {
+    while (ms > 0) {
+        uint32_t step = ms < 60000 ? ms : 60000;
+        radioAdvance(step * 1000);
+        rfmDutyCycleBudget();
+        ms -= step;
+    }
+}
+
+/**
+ * Sets the LoRa modem configuration with the given spreading factor,
+ * 125 kHz, CR 4/5, explicit header, CRC and LDRO from SF11.
+ */
+static void modem(uint8_t sf) {
+    radioReg[RFM_LORA_MODEM_CONFIG1] = 0x72;
+    radioReg[RFM_LORA_MODEM_CONFIG2] = (sf << 4) | 0x04;
+    radioReg[RFM_LORA_MODEM_CONFIG3] = sf >= 11 ? 0x08 : 0x00;
+}
+
+/**
+ * Sends packets until the duty cycle is exceeded and verifies the wait
+ * time for the oldest and two oldest records.
+ */
+static void testWait(void) {
+    rfmSetFrequency(868100);
+    // 51 bytes 2465.792 ms, 128 bytes 4923.392 ms
+    modem(12);
+    check(rfmDutyCycleBudget() == LIMIT_868 * 1000);
+    check(rfmDutyCycleWait(51) == 0);
+
+    uint32_t at[14];
+    for (uint8_t i = 0; i < 14; i++) {
+        check(rfmLoRaTx(payload, 51) == 51);
+        at[i] = radioMillis();
+        advance(60000);
+    }
+    check(rfmDutyCycleBudget() == (LIMIT_868 - 14 * 2466) * 1000);
+
+    // 15th packet exceeds the duty cycle and is not sent
+    uint16_t frames = radioFrames;
+    check(rfmLoRaTx(payload, 51) == 0);
+    check(radioFrames == frames);
+
+    uint32_t now = radioMillis();
+    // the oldest record frees enough airtime
+    check(rfmDutyCycleWait(51) == (3600000UL - (now - at[0])) * 1000);
+    // two oldest records needed for a larger packet
+    check(rfmDutyCycleWait(128) == (3600000UL - (now - at[1])) * 1000);
+    // more than the budget per hour
+    radioReg[RFM_LORA_MODEM_CONFIG1] = 0x02; // 7.8 kHz
+    check(rfmDutyCycleWait(128) == UINT32_MAX);
+    modem(12);
+
+    // just before and after the oldest record expires
+    advance(3600000UL - (now - at[0]) - 1);
+    check(rfmDutyCycleWait(51) == 1000);
+    check(rfmLoRaTx(payload, 51) == 0);
+    advance(1);
+    check(rfmDutyCycleWait(51) == 0);
+    check(rfmLoRaTx(payload, 51) == 51);
+
+    // not regulated
+    rfmSetFrequency(915000);
+    check(rfmDutyCycleBudget() == UINT32_MAX);
+    check(rfmDutyCycleWait(128) == 0);
+
+    // all records expire
+    rfmSetFrequency(868100);
+    advance(3600000UL);
+    check(rfmDutyCycleBudget() == LIMIT_868 * 1000);
+}
+
+/**
+ * Sends more packets than there are airtime records and verifies that
+ * merged records neither lose airtime nor let it expire too early.
+ */
+static void testMerge(void) {
+    rfmSetFrequency(868100);
+    // 10 bytes 41.216 ms
+    modem(7);
+
+    uint32_t at[RFM_DC_RECORDS];
+    for (uint8_t i = 0; i < RFM_DC_RECORDS; i++) {
+        check(rfmLoRaTx(payload, 10) == 10);
+        at[i] = radioMillis();
+        advance(1000);
+    }
+    check(rfmDutyCycleBudget() == (LIMIT_868 - RFM_DC_RECORDS * 42) * 1000);
+
+    // no free record, added to one of the same sub-band
+    check(rfmLoRaTx(payload, 10) == 10);
+    check(rfmDutyCycleBudget() ==
+            (LIMIT_868 - (RFM_DC_RECORDS + 1) * 42) * 1000);
+    advance(1000);
+
+    // no record of this sub-band, the two oldest of the other are merged
+    rfmSetFrequency(869500);
+    check(rfmLoRaTx(payload, 10) == 10);
+    check(rfmDutyCycleBudget() == (LIMIT_869 - 42) * 1000);
+    rfmSetFrequency(868100);
+    check(rfmDutyCycleBudget() ==
+            (LIMIT_868 - (RFM_DC_RECORDS + 1) * 42) * 1000);
+
+    // the oldest airtime was moved to later and did not expire yet
+    uint32_t now = radioMillis();
+    advance(3600000UL - (now - at[0]) + 500);
+    check(rfmDutyCycleBudget() ==
+            (LIMIT_868 - (RFM_DC_RECORDS + 1) * 42) * 1000);
+
+    // expired together with the second oldest
+    now = radioMillis();
+    advance(3600000UL - (now - at[1]));
+    check(rfmDutyCycleBudget() ==
+            (LIMIT_868 - (RFM_DC_RECORDS - 1) * 42) * 1000);
+
+    advance(3600000UL);
+    check(rfmDutyCycleBudget() == LIMIT_868 * 1000);
+    rfmSetFrequency(869500);
+    check(rfmDutyCycleBudget() == LIMIT_869 * 1000);
+}
+
+int main(void) {
+    radioReset();
+    check(rfmInit(868100, 0x24, 0x84, true));
+
+    testWait();
+    testMerge();
+
+    return radioDone("dutycycle");
+}
@@ -0,0 +1,29 @@
+/*
+ * File:   frf.c
+ *
+ * Host test verifying that RFM_FRF() with 32-bit arithmetic is bit-identical 
+ * to the 64-bit formula for every kHz from 137 to 1020 MHz.
+ */
+
+#include <stdio.h>
+#include "librfm95.h"
+
+int main(void) {
+    unsigned long fails = 0;
+
+    for (uint32_t kHz = 137000; kHz <= 1020000; kHz++) {
+        uint32_t expected = (uint64_t)kHz * 1000000UL / RFM_F_STEP;
+        uint32_t actual = RFM_FRF(kHz);
+        if (actual != expected) {
+            if (fails++ < 10) {
+                printf("%lu kHz: expected 0x%06lx, got 0x%06lx\n",
+                        (unsigned long)kHz, (unsigned long)expected,
+                        (unsigned long)actual);
+            }
+        }
+    }
+
+    printf("RFM_FRF: %lu mismatches\n", fails);
+
+    return fails == 0 ? 0 : 1;
+}
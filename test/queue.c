@@ -0,0 +1,119 @@
+/*
+ * File:   queue.c
+ *
+ * Host test verifying that queued messages are sent by priority, that
+ * coalescable messages for the same node are packed into one packet, and
+ * that rfmUnpack() splits it into the original messages.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "librfm95.h"
+#include "radio.h"
+
+/**
+ * Returns true if the next message unpacked from the last packet sent
+ * equals the given string.
+ */
+static bool unpacked(size_t *offset, const char *expected) {
+    size_t len = 0;
+    uint8_t *msg = rfmUnpack(radioFrame, radioFrameLen, offset, &len);
+
+    return msg != NULL && len == strlen(expected) &&
+            memcmp(msg, expected, len) == 0;
+}
+
+/**
+ * Queues messages with different priority, coalescability and node and
+ * verifies the packets sent and their contents.
+ */
+static void testOrder(void) {
+    uint8_t abc[] = "abc";
+    uint8_t hello[] = "hello";
+    uint8_t urgent[] = "urgent";
+    uint8_t x[] = "x";
+
+    check(rfmQueueAdd(abc, 3, 0x24, 0, true));
+    check(rfmQueueAdd(hello, 5, 0x24, 0, true));
+    check(rfmQueueAdd(urgent, 6, 0x24, 5, false));
+    check(rfmQueueAdd(x, 1, 0x42, 0, true));
+    check(rfmQueueLength() == 4);
+    check(rfmQueueWait() == 0);
+
+    // highest priority first, as is
+    check(rfmQueueSend() == 1);
+    check(radioFrameNode == 0x24);
+    check(radioFrameLen == 6 && memcmp(radioFrame, urgent, 6) == 0);
+
+    // both for the same node packed together
+    check(rfmQueueSend() == 2);
+    check(radioFrameNode == 0x24);
+    check(radioFrameLen == 1 + 3 + 1 + 5);
+    size_t offset = 0;
+    check(unpacked(&offset, "abc"));
+    check(unpacked(&offset, "hello"));
+    check(unpacked(&offset, "") == false);
+
+    check(rfmQueueSend() == 1);
+    check(radioFrameNode == 0x42);
+    offset = 0;
+    check(unpacked(&offset, "x"));
+    check(unpacked(&offset, "") == false);
+
+    check(rfmQueueLength() == 0);
+    check(rfmQueueSend() == 0);
+}
+
+/**
+ * Fills the queue and verifies that packing stops at the maximum payload
+ * size.
+ */
+static void testFull(void) {
+    uint8_t msgs[RFM_QUEUE_SIZE][11];
+    for (uint8_t i = 0; i < RFM_QUEUE_SIZE; i++) {
+        snprintf((char *)msgs[i], sizeof(msgs[i]), "message %02u", i);
+        check(rfmQueueAdd(msgs[i], 10, 0x24, 0, true));
+    }
+    check(rfmQueueAdd(msgs[0], 10, 0x24, 0, true) == false);
+
+    // 5 length-prefixed messages fit in 63 bytes, 6 don't
+    check(rfmQueueSend() == 5);
+    check(radioFrameLen == 5 * 11);
+    size_t offset = 0;
+    for (uint8_t i = 0; i < 5; i++) {
+        check(unpacked(&offset, (char *)msgs[i]));
+    }
+    check(unpacked(&offset, "") == false);
+
+    check(rfmQueueSend() == RFM_QUEUE_SIZE - 5);
+    offset = 0;
+    for (uint8_t i = 5; i < RFM_QUEUE_SIZE; i++) {
+        check(unpacked(&offset, (char *)msgs[i]));
+    }
+    check(rfmQueueLength() == 0);
+}
+
+/**
+ * Verifies that a truncated frame is not unpacked beyond its size.
+ */
+static void testTruncated(void) {
+    uint8_t frame[] = {3, 'a', 'b', 'c', 5, 'h', 'e'};
+    size_t offset = 0;
+    size_t len = 0;
+
+    check(rfmUnpack(frame, sizeof(frame), &offset, &len) == &frame[1]);
+    check(len == 3 && offset == 4);
+    check(rfmUnpack(frame, sizeof(frame), &offset, &len) == NULL);
+    check(offset == 4);
+}
+
+int main(void) {
+    radioReset();
+    check(rfmInit(868100, 0x24, 0x84, false));
+
+    testOrder();
+    testFull();
+    testTruncated();
+
+    return radioDone("queue");
+}
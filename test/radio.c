@@ -0,0 +1,172 @@
+/*
+ * File:   radio.c
+ *
+ * Simulated radio implementing the _rfm* functions for host tests.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "librfm95.h"
+#include "radio.h"
+
+uint8_t radioReg[128];
+
+uint8_t radioFrame[256];
+size_t radioFrameLen = 0;
+uint8_t radioFrameNode = 0;
+uint16_t radioFrames = 0;
+
+static uint8_t fifo[256];
+static uint8_t fifoPtrFSK = 0;
+
+/* Clock in microseconds, not wrapping around */
+static uint64_t micros = 0;
+
+/* SPI transfer state: address byte expected, or register and direction */
+static bool selected = false;
+static bool addressed = false;
+static uint8_t address = 0;
+static bool write = false;
+
+/* Interrupt to be handled when the radio is deselected */
+static bool irqPending = false;
+
+static unsigned checks = 0;
+static unsigned fails = 0;
+
+void radioReset(void) {
+    memset(radioReg, 0, sizeof(radioReg));
+    memset(fifo, 0, sizeof(fifo));
+    // version and POR bit rate 4.8 kBit/s
+    radioReg[RFM_VERSION] = 0x12;
+    radioReg[RFM_FSK_BITRATE_MSB] = 0x1a;
+    radioReg[RFM_FSK_BITRATE_LSB] = 0x0b;
+    fifoPtrFSK = 0;
+    radioFrameLen = 0;
+    radioFrames = 0;
+    irqPending = false;
+    micros = 0;
+}
+
+void radioAdvance(uint32_t us) {
+    micros += us;
+}
+
+uint32_t radioMillis(void) {
+    return micros / 1000;
+}
+
+void radioCheck(int ok, const char *cond, const char *file, int line) {
+    checks++;
+    if (!ok) {
+        fails++;
+        printf("%s:%d: check failed: %s\n", file, line, cond);
+    }
+}
+
+int radioDone(const char *name) {
+    printf("%s: %u checks, %u failed\n", name, checks, fails);
+
+    return fails == 0 ? 0 : 1;
+}
+
+/**
+ * Takes the packet in the FIFO as transmitted, advances the clock by its
+ * time on air and flags "PacketSent"/"TxDone", going back to standby.
+ */
+static void transmit(void) {
+    bool lora = radioReg[RFM_OP_MODE] & 0x80;
+    if (lora) {
+        radioFrameLen = radioReg[RFM_LORA_PAYLD_LEN];
+        radioFrameNode = 0;
+        for (size_t i = 0; i < radioFrameLen; i++) {
+            radioFrame[i] = fifo[(uint8_t)(radioReg[RFM_LORA_FIFO_TX_ADDR] + i)];
+        }
+        radioReg[RFM_LORA_IRQ_FLAGS] |= 0x08;
+    } else {
+        radioFrameLen = fifo[0] - 1;
+        radioFrameNode = fifo[1];
+        memcpy(radioFrame, &fifo[2], radioFrameLen);
+        fifoPtrFSK = 0;
+        radioReg[RFM_FSK_IRQ_FLAGS2] |= 0x08;
+    }
+    radioFrames++;
+    micros += rfmTimeOnAir(radioFrameLen);
+    radioReg[RFM_OP_MODE] = (radioReg[RFM_OP_MODE] & ~RFM_MASK_MODE) |
+            RFM_MODE_STDBY;
+    irqPending = true;
+}
+
+void _rfmDelay5(void) {
+    micros += 5000;
+}
+
+void _rfmOn(void) {}
+
+void _rfmSel(void) {
+    selected = true;
+    addressed = false;
+}
+
+void _rfmDes(void) {
+    selected = false;
+    if (irqPending) {
+        irqPending = false;
+        rfmIrq();
+    }
+}
+
+uint8_t _rfmTx(uint8_t data) {
+    if (!selected) {
+        return 0;
+    }
+    if (!addressed) {
+        address = data & 0x7f;
+        write = data & 0x80;
+        addressed = true;
+
+        return 0;
+    }
+
+    bool lora = radioReg[RFM_OP_MODE] & 0x80;
+    uint8_t value = 0;
+    if (address == RFM_FIFO) {
+        // FIFO access does not increment the address
+        uint8_t *ptr = lora ? &radioReg[RFM_LORA_FIFO_ADDR_PTR] : &fifoPtrFSK;
+        if (write) {
+            fifo[*ptr] = data;
+        } else {
+            value = fifo[*ptr];
+        }
+        (*ptr)++;
+
+        return value;
+    }
+
+    if (write) {
+        if (lora && address == RFM_LORA_IRQ_FLAGS) {
+            // writing 1 clears a flag
+            radioReg[address] &= ~data;
+        } else if (!lora && address == RFM_FSK_IRQ_FLAGS2) {
+            // FIFO flags are read-only
+        } else {
+            radioReg[address] = data;
+        }
+        if (address == RFM_OP_MODE) {
+            // "PacketSent" is cleared when leaving TX mode
+            radioReg[RFM_FSK_IRQ_FLAGS2] &= ~0x08;
+            if ((data & RFM_MASK_MODE) == RFM_MODE_TX) {
+                transmit();
+            }
+        }
+    } else {
+        value = radioReg[address];
+    }
+    address = (address + 1) & 0x7f;
+
+    return value;
+}
+
+uint32_t _rfmMicros(void) {
+    return (uint32_t)micros;
+}
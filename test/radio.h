@@ -0,0 +1,59 @@
+/*
+ * File:   radio.h
+ *
+ * Simulated radio implementing the _rfm* functions for host tests:
+ * registers, FIFO and SPI transfers, a microsecond clock and transmission
+ * of a packet taking its time on air.
+ */
+
+#ifndef RADIO_H
+#define RADIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Registers of the simulated radio */
+extern uint8_t radioReg[128];
+
+/* Last packet transmitted and number of packets transmitted */
+extern uint8_t radioFrame[256];
+extern size_t radioFrameLen;
+extern uint8_t radioFrameNode;
+extern uint16_t radioFrames;
+
+/**
+ * Resets the radio and clock.
+ */
+void radioReset(void);
+
+/**
+ * Advances the clock by the given number of microseconds.
+ *
+ * @param us microseconds
+ */
+void radioAdvance(uint32_t us);
+
+/**
+ * Returns the clock in milliseconds, which unlike _rfmMicros() does not
+ * wrap around after 71 minutes.
+ *
+ * @return milliseconds
+ */
+uint32_t radioMillis(void);
+
+/**
+ * Counts and prints a failed check.
+ */
+#define check(cond) radioCheck(cond, #cond, __FILE__, __LINE__)
+
+void radioCheck(int ok, const char *cond, const char *file, int line);
+
+/**
+ * Prints the number of failed checks and returns the exit status.
+ *
+ * @param name of test
+ * @return exit status
+ */
+int radioDone(const char *name);
+
+#endif /* RADIO_H */
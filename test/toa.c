@@ -0,0 +1,60 @@
+/*
+ * File:   toa.c
+ *
+ * Host test verifying rfmTimeOnAir() in LoRa mode against values of the
+ * AN1200.13 formula as given by Semtech's LoRa calculator, and in FSK mode.
+ */
+
+#include <stdio.h>
+#include "librfm95.h"
+#include "radio.h"
+
+/**
+ * Sets the LoRa modem configuration with the given spreading factor,
+ * bandwidth index (7 = 125 kHz), coding rate 4/(4 + cr), header mode,
+ * CRC, low data rate optimization and preamble length.
+ */
+static void modem(uint8_t sf, uint8_t bw, uint8_t cr, bool implicit,
+                  bool crc, bool ldro, uint16_t preamble) {
+    radioReg[RFM_LORA_MODEM_CONFIG1] = (bw << 4) | (cr << 1) | implicit;
+    radioReg[RFM_LORA_MODEM_CONFIG2] = (sf << 4) | (crc << 2);
+    radioReg[RFM_LORA_MODEM_CONFIG3] = ldro << 3;
+    radioReg[RFM_LORA_PREA_LEN_MSB] = preamble >> 8;
+    radioReg[RFM_LORA_PREA_LEN_LSB] = preamble;
+}
+
+int main(void) {
+    radioReset();
+    check(rfmInit(868100, 0x24, 0x84, true));
+
+    // SF7/125 kHz, CR 4/5, explicit header, CRC, 10 bytes: 41.216 ms
+    modem(7, 7, 1, false, true, false, 8);
+    check(rfmTimeOnAir(10) == 41216);
+
+    // same with implicit header and no CRC: 36.096 ms
+    modem(7, 7, 1, true, false, false, 8);
+    check(rfmTimeOnAir(10) == 36096);
+
+    // SF12/125 kHz, CR 4/5, LDRO, 51 bytes: 2465.792 ms
+    modem(12, 7, 1, false, true, true, 8);
+    check(rfmTimeOnAir(51) == 2465792);
+
+    // SF9/250 kHz, CR 4/8, 20 bytes: 123.392 ms
+    modem(9, 8, 4, false, true, false, 8);
+    check(rfmTimeOnAir(20) == 123392);
+
+    // SF12/7.8 kHz, CR 4/5, LDRO, 128 bytes: 78.900 s
+    modem(12, 0, 1, false, true, true, 8);
+    check(rfmTimeOnAir(128) == 78900482);
+    // payload is limited to 128 bytes
+    check(rfmTimeOnAir(255) == rfmTimeOnAir(128));
+
+    radioReset();
+    check(rfmInit(868100, 0x24, 0x84, false));
+
+    // 4.8 kBit/s, 5 bytes preamble, 3 bytes sync word, length, address,
+    // 10 bytes payload and CRC: 22 bytes of 208.3 µs
+    check(rfmTimeOnAir(10) == 22UL * 8 * 6667 / 32);
+
+    return radioDone("toa");
+}